@@ -0,0 +1,121 @@
+#!/bin/bash
+# Time fs on generated images, comparing builds of several revisions.
+#
+# Usage: bench/bench.sh [-n runs] [-c pattern] [revision...]
+#
+# Each revision is built with the same command as the Makefile, or with $CC and $CFLAGS
+# when set. "worktree" builds the checked out fs.c and is the default. -c only runs the
+# cases whose label matches the pattern.
+#
+# Prints the median milliseconds per run. A '*' marks output that differs from the last
+# revision's, such as revisions that don't support the case. Runs that take over 10 seconds
+# or crash are reported as such instead of timed.
+set -e
+cd "$(dirname "$0")/.."
+
+runs=50
+pattern=
+while getopts "n:c:" option; do
+    case $option in
+        n) runs=$OPTARG ;;
+        c) pattern=$OPTARG ;;
+        *) exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+revisions=("$@")
+[ ${#revisions[@]} -eq 0 ] && revisions=(worktree)
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+# Label, image and arguments of each case, separated by '|'
+all_cases=(
+    "lookup 8.3 name, 8.3-only directory|lookup83|--test-file-name F0014999"
+    "lookup 8.3 name, LFN directory|lookup|--test-file-name F0014999"
+    "lookup long name, LFN directory|lookup|--test-file-name a long file name number 14999.data"
+    "FAT16 contents, contiguous 14 MB|chain16|--test-file-contents CONTIG.BIN"
+    "FAT16 contents, fragmented 14 MB|chain16|--test-file-contents FRAG.BIN"
+    "FAT16 clusters, contiguous 28000|chain16|--test-file-clusters 2"
+    "FAT16 lookup, fragmented directory|chain16|--test-file-name DIR/F0019999"
+    "FAT16 space usage|chain16|--test-space-usage"
+    "FAT32 contents, contiguous 14 MB|chain32|--test-file-contents CONTIG.BIN"
+    "FAT32 contents, fragmented 14 MB|chain32|--test-file-contents FRAG.BIN"
+    "FAT32 clusters, contiguous 28000|chain32|--test-file-clusters 3"
+    "FAT32 lookup, fragmented directory|chain32|--test-file-name DIR/F0019999"
+    "FAT32 space usage|chain32|--test-space-usage"
+)
+cases=()
+for c in "${all_cases[@]}"; do
+    [[ -z $pattern || ${c%%|*} =~ $pattern ]] && cases+=("$c")
+done
+
+# Build only the images the chosen cases need
+for c in "${cases[@]}"; do
+    IFS='|' read -r label image args <<< "$c"
+    [ -f "$work/$image" ] || tclsh bench/make-image.tcl $image "$work/$image" > /dev/null
+done
+
+for rev in "${revisions[@]}"; do
+    if [ "$rev" = worktree ]; then
+        cp fs.c "$work/fs-$rev.c"
+    else
+        git show "$rev:fs.c" > "$work/fs-$rev.c"
+    fi
+    ${CC:-gcc} $CFLAGS -w -o "$work/fs-$rev" "$work/fs-$rev.c"
+done
+
+declare -A result mark
+printf "%-45s" "case"
+printf "%13s" "${revisions[@]}"
+printf "\n"
+for c in "${cases[@]}"; do
+    IFS='|' read -r label image args <<< "$c"
+    # The long name contains spaces, so keep the option and its value as two words
+    option=${args%% *}
+    value=${args#* }
+    run() {
+        timeout 10 "$work/fs-$1" $option "$value" --image "$work/$image"
+    }
+
+    run "${revisions[-1]}" > "$work/output" || true
+    expected=$(md5sum < "$work/output")
+    timed=()
+    for rev in "${revisions[@]}"; do
+        status=0
+        { run $rev > "$work/output"; } 2> /dev/null || status=$?
+        if [ $status = 124 ]; then
+            result[$rev]=timeout
+        elif [ $status -gt 128 ]; then
+            result[$rev]=crashed
+        else
+            result[$rev]=
+            timed+=($rev)
+            mark[$rev]=" "
+            [ "$(md5sum < "$work/output")" != "$expected" ] && mark[$rev]="*"
+            : > "$work/times-$rev"
+        fi
+    done
+
+    # Alternate between the revisions on every run, so a machine that slows down or speeds
+    # up affects them all alike, and report the median run
+    for ((i = 0; i < runs; i++)); do
+        for rev in "${timed[@]}"; do
+            start=$EPOCHREALTIME
+            run $rev > /dev/null || true
+            end=$EPOCHREALTIME
+            echo "$start $end" >> "$work/times-$rev"
+        done
+    done
+
+    printf "%-45s" "$label"
+    for rev in "${revisions[@]}"; do
+        if [ -n "${result[$rev]}" ]; then
+            printf "%13s" "${result[$rev]}"
+        else
+            awk '{ print ($2 - $1) * 1000 }' "$work/times-$rev" | sort -n |
+                awk -v mark="${mark[$rev]}" '{ t[NR] = $1 } END { printf "%12.2f%s", NR % 2 ? t[(NR + 1) / 2] : (t[NR / 2] + t[NR / 2 + 1]) / 2, mark }'
+        fi
+    done
+    printf "\n"
+done
@@ -0,0 +1,90 @@
+# Build the images used by bench.sh with the image helpers from the testsuite.
+#
+# Usage: tclsh bench/make-image.tcl <kind> <image> [files]
+#
+#   lookup     FAT16 image whose root directory holds many files with long names
+#   lookup83   The same root directory with 8.3 names only
+#   chain16    FAT16 image with a 14 MB contiguous file CONTIG.BIN, a 14 MB file FRAG.BIN whose
+#              clusters alternate between two halves of its region, and a directory DIR of 20000
+#              entries whose clusters are scattered the same way
+#   chain32    The same files on FAT32
+source [file join [file dirname [info script]] .. testsuite lib fs.exp]
+
+# Fill each cluster of a file with its index in the file, then link them
+proc numbered_file {clusters} {
+    set i 0
+    foreach cluster $clusters {
+	fat_write [fat_cluster_offset $cluster] [format "%511d\n" $i]
+	incr i
+    }
+    fat_chain {*}$clusters
+}
+
+lassign $argv kind image files
+if {$files eq ""} { set files 15000 }
+
+switch $kind {
+    lookup - lookup83 {
+	# Long names of up to 39 characters take three LFN entries before the short entry,
+	# and the FAT16 root directory holds at most 65535 entries
+	set per_file [expr {$kind eq "lookup" ? 4 : 1}]
+	set root_entries [expr {($files * $per_file + 15) / 16 * 16}]
+	# Stay above the 4085 clusters where the image would become FAT12
+	fat_create $image 16 [expr {$root_entries / 16 + 5000}] $root_entries
+
+	set offset $fat(root_start)
+	for {set i 0} {$i < $files} {incr i} {
+	    set name [format "F%07d   " $i]
+	    if {$kind eq "lookup"} {
+		set offset [fat_long_entry $offset "a long file name number $i.data" $name 0x20 0 0]
+	    } else {
+		fat_entry $offset $name 0x20 0 0
+		incr offset 32
+	    }
+	}
+	fat_close
+    }
+    chain16 - chain32 {
+	set type [string range $kind end-1 end]
+	fat_create $image $type [expr {$type == 32 ? 70000 : 62000}]
+	if {$type == 32} {
+	    set root [fat_cluster_offset 2]
+	    set next 3
+	} else {
+	    set root $fat(root_start)
+	    set next 2
+	}
+
+	# Contiguous clusters, as a freshly written file would have
+	set clusters {}
+	for {set i 0} {$i < 28000} {incr i} { lappend clusters [expr {$next + $i}] }
+	numbered_file $clusters
+	fat_entry $root "CONTIG  BIN" 0x20 $next [expr {28000 * 512}]
+	incr next 28000
+
+	# Every step of the chain jumps between the two halves of the region
+	set clusters {}
+	for {set i 0} {$i < 14000} {incr i} { lappend clusters [expr {$next + $i}] [expr {$next + 14000 + $i}] }
+	numbered_file $clusters
+	fat_entry [expr {$root + 32}] "FRAG    BIN" 0x20 $next [expr {28000 * 512}]
+	incr next 28000
+
+	# 20000 entries take 1250 clusters, laid out like FRAG.BIN
+	set clusters {}
+	for {set i 0} {$i < 625} {incr i} { lappend clusters [expr {$next + $i}] [expr {$next + 625 + $i}] }
+	fat_chain {*}$clusters
+	fat_entry [expr {$root + 64}] "DIR        " 0x10 $next 0
+	set i 0
+	foreach cluster $clusters {
+	    for {set slot 0} {$slot < 16} {incr slot} {
+		fat_entry [expr {[fat_cluster_offset $cluster] + $slot * 32}] [format "F%07d   " $i] 0x20 0 0
+		incr i
+	    }
+	}
+	fat_close
+    }
+    default {
+	puts stderr "unknown image kind $kind"
+	exit 1
+    }
+}
@@ -1,18 +1,36 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
 
+struct dir_cursor;
+
+// FAT access specialized per FAT width, selected once when the image is opened
+struct fat_ops {
+    void (*print_chain)(void *file_system, unsigned int cluster);
+    void (*print_file)(void *file_system, unsigned int cluster, unsigned int size);
+    void (*next_dir_cluster)(void *file_system, struct dir_cursor *dir);
+    int (*count_allocated)(void *file_system);
+};
+
 // Struct for storing image data
 struct fs_data {
     int bytes_per_sector, sectors_per_cluster, reserved_sectors, number_of_fats, sectors_per_fat, num_logical_sectors;
     int max_root_directory_entries, max_entries;
     int media_descriptor;
-    int root_directory_start;
-    int fat_start, fat_size;
+    int fat_type, cluster_count, cluster_size;
+    // Byte offsets into the image, which can be larger than 2 GiB for FAT32
+    off_t root_directory_start, fat_start, fat_size, data_start, image_size;
+    long long total_sectors;
+    unsigned int root_cluster, cluster_high_mask;
+    struct fat_ops *ops;
+    // One bit per cluster, marking directories already searched by get_stats()
+    unsigned char *visited;
+    size_t visited_size;
 } data;
 
 // Struct for storing entry data
@@ -24,34 +42,449 @@ struct entry {
     int modify_time, modify_seconds, modify_minutes, modify_hours, modify_ms;
 } entry_data;
 
-// Read from a specific place in the filesystem
-unsigned int get_bytes(void *file_system, int offset, int size) {
+// Read from a specific place in the filesystem, at most 4 bytes at a time
+unsigned int get_bytes(void *file_system, off_t offset, int size) {
     unsigned int bytes = 0;
     for (int i = 0; i < size; i++) {
         // Bitwise or the file system bytes into place and leftshift to read more up to size
-        bytes |= ((unsigned char *)file_system)[offset + i] << i * 8;
+        bytes |= (unsigned int)((unsigned char *)file_system)[offset + i] << i * 8;
     }
     return bytes;
 }
 
-// Add image data to structure
-void build_fs_data(void *file_system) {
+// Byte offset of a data cluster in the image
+off_t cluster_offset(unsigned int cluster) {
+    return data.data_start + (off_t)(cluster - 2) * data.cluster_size;
+}
+
+// Check a cluster number read from the image against the validated data area
+int valid_cluster(unsigned int cluster) {
+    // Clusters 0 and 1 wrap around to huge values, so one comparison covers both ends
+    return cluster - 2 < (unsigned int)data.cluster_count;
+}
+
+// Brent's cycle detection for walking cluster chains without extra memory
+struct chain_guard {
+    unsigned int saved;
+    int steps, limit;
+};
+
+void guard_start(struct chain_guard *guard, unsigned int cluster) {
+    guard->saved = cluster;
+    guard->steps = 0;
+    guard->limit = 1;
+}
+
+// Returns 1 once the chain comes back to a cluster it has already visited
+int chain_loops(struct chain_guard *guard, unsigned int cluster) {
+    if (cluster == guard->saved) return 1;
+    // Move the saved cluster forward at doubling intervals
+    if (++guard->steps == guard->limit) {
+        guard->saved = cluster;
+        guard->steps = 0;
+        guard->limit *= 2;
+    }
+    return 0;
+}
+
+// Position within a directory, following its cluster chain when it has one
+struct dir_cursor {
+    unsigned int cluster;
+    off_t offset, end;
+    struct chain_guard guard;
+};
+
+// FAT12 packs two 12-bit entries into every three bytes
+unsigned int next_cluster_fat12(void *file_system, unsigned int cluster) {
+    unsigned int pair = get_bytes(file_system, data.fat_start + cluster + cluster / 2, 2);
+    // Odd clusters live in the upper 12 bits of the pair
+    return (pair >> ((cluster & 1) * 4)) & 0xFFF;
+}
+
+unsigned int next_cluster_fat16(void *file_system, unsigned int cluster) {
+    return get_bytes(file_system, data.fat_start + cluster * 2, 2);
+}
+
+// The top 4 bits of a FAT32 entry are reserved
+unsigned int next_cluster_fat32(void *file_system, unsigned int cluster) {
+    return get_bytes(file_system, data.fat_start + cluster * 4, 4) & 0x0FFFFFFF;
+}
+
+// Generate the chain walks for one FAT width so the loops never branch on the FAT type
+#define FAT_WIDTH(bits) \
+    void print_chain_fat##bits(void *file_system, unsigned int cluster) { \
+        struct chain_guard guard; \
+        guard_start(&guard, cluster); \
+        while (valid_cluster(cluster)) { \
+            printf("%u -> ", cluster); \
+            cluster = next_cluster_fat##bits(file_system, cluster); \
+            if (chain_loops(&guard, cluster)) { \
+                printf("LOOP\n"); \
+                return; \
+            } \
+        } \
+        printf("EOF\n"); \
+    } \
+    void print_file_fat##bits(void *file_system, unsigned int cluster, unsigned int size) { \
+        struct chain_guard guard; \
+        guard_start(&guard, cluster); \
+        while (size > 0 && valid_cluster(cluster)) { \
+            unsigned int chunk = size < (unsigned int)data.cluster_size ? size : (unsigned int)data.cluster_size; \
+            fwrite(file_system + cluster_offset(cluster), 1, chunk, stdout); \
+            size -= chunk; \
+            cluster = next_cluster_fat##bits(file_system, cluster); \
+            if (chain_loops(&guard, cluster)) break; \
+        } \
+    } \
+    void next_dir_cluster_fat##bits(void *file_system, struct dir_cursor *dir) { \
+        unsigned int next = next_cluster_fat##bits(file_system, dir->cluster); \
+        if (valid_cluster(next) && !chain_loops(&dir->guard, next)) { \
+            dir->cluster = next; \
+            dir->offset = cluster_offset(next); \
+            dir->end = dir->offset + data.cluster_size; \
+        } \
+    } \
+    int count_allocated_fat##bits(void *file_system) { \
+        int count = 0; \
+        for (int i = 2; i < data.cluster_count + 2; i++) { \
+            if (next_cluster_fat##bits(file_system, i) != 0) count++; \
+        } \
+        return count; \
+    } \
+    struct fat_ops fat##bits##_ops = { print_chain_fat##bits, print_file_fat##bits, next_dir_cluster_fat##bits, count_allocated_fat##bits };
+
+FAT_WIDTH(12)
+FAT_WIDTH(16)
+FAT_WIDTH(32)
+
+// Add image data to structure, returning 0 if the image can't hold a FAT file system.
+// The boot sector fields are filled in either way, as long as the image has a boot sector.
+// Every region is checked against the image size here, so later reads only need to
+// validate cluster numbers taken from the FAT and directory entries.
+int build_fs_data(void *file_system, off_t size) {
+    data.image_size = size;
+    // The BIOS parameter block lives in the first sector
+    if (size < 512) return 0;
+
     data.bytes_per_sector = get_bytes(file_system, 0x00B, 2);
     data.sectors_per_cluster = get_bytes(file_system, 0x00D, 1);
     data.reserved_sectors = get_bytes(file_system, 0x00E, 2);
     data.number_of_fats = get_bytes(file_system, 0x010, 1);
-    data.fat_start = data.bytes_per_sector * data.reserved_sectors;
     data.max_root_directory_entries = get_bytes(file_system, 0x011, 2);
     data.num_logical_sectors = get_bytes(file_system, 0x013, 2);
     data.media_descriptor = get_bytes(file_system, 0x015, 1);
-    data.sectors_per_fat = get_bytes(file_system, 0x016, 2);
-    data.fat_size = data.bytes_per_sector * data.sectors_per_fat;
-    data.root_directory_start = (data.bytes_per_sector * data.reserved_sectors) + (data.bytes_per_sector * data.sectors_per_fat * data.number_of_fats);
     data.max_entries = get_bytes(file_system, 0x011, 2);
+    // FAT32 keeps the FAT size in the extended boot sector
+    long long sectors_per_fat = get_bytes(file_system, 0x016, 2);
+    if (sectors_per_fat == 0) sectors_per_fat = get_bytes(file_system, 0x024, 4);
+    data.sectors_per_fat = sectors_per_fat;
+
+    // Sector and cluster sizes must be powers of two
+    if (data.bytes_per_sector < 512 || data.bytes_per_sector > 4096 || (data.bytes_per_sector & (data.bytes_per_sector - 1)) != 0) return 0;
+    if (data.sectors_per_cluster == 0 || (data.sectors_per_cluster & (data.sectors_per_cluster - 1)) != 0) return 0;
+    if (data.reserved_sectors == 0 || data.number_of_fats == 0) return 0;
+
+    // Large images store the sector count at 0x020 instead
+    long long total_sectors = data.num_logical_sectors;
+    if (total_sectors == 0) total_sectors = get_bytes(file_system, 0x020, 4);
+
+    // The FATs, the root directory and the start of the data area must all be inside the image
+    long long fat_start = (long long)data.bytes_per_sector * data.reserved_sectors;
+    long long fat_size = (long long)data.bytes_per_sector * sectors_per_fat;
+    long long root_directory_start = fat_start + (fat_size * data.number_of_fats);
+    long long root_directory_sectors = ((data.max_entries * 32) + (data.bytes_per_sector - 1)) / data.bytes_per_sector;
+    long long data_start = root_directory_start + (root_directory_sectors * data.bytes_per_sector);
+    if (sectors_per_fat == 0 || data_start > size) return 0;
+
+    data.fat_start = fat_start;
+    data.fat_size = fat_size;
+    data.root_directory_start = root_directory_start;
+    data.data_start = data_start;
+    data.cluster_size = data.bytes_per_sector * data.sectors_per_cluster;
+    data.total_sectors = total_sectors;
+
+    // The FAT width is decided by the cluster count, except that formatters can make FAT16 images
+    // with fewer clusters than FAT12 allows. Those have a FAT sized for 16-bit entries and say FAT16.
+    long long cluster_count = (total_sectors - (data_start / data.bytes_per_sector)) / data.sectors_per_cluster;
+    if (cluster_count <= 0) return 0;
+    int small_fat16 = fat_size * 8 / 16 >= cluster_count + 2 && memcmp(file_system + 0x036, "FAT16   ", 8) == 0;
+    if (cluster_count < 4085 && !small_fat16) {
+        data.fat_type = 12;
+        data.ops = &fat12_ops;
+    } else if (cluster_count < 65525) {
+        data.fat_type = 16;
+        data.ops = &fat16_ops;
+    } else {
+        data.fat_type = 32;
+        data.ops = &fat32_ops;
+        // Larger values are reserved for bad clusters and EOF
+        if (cluster_count > 0x0FFFFFF5) cluster_count = 0x0FFFFFF5;
+    }
+
+    // Only use clusters that both have a FAT entry and fit in the image
+    long long fat_entries = fat_size * 8 / data.fat_type;
+    if (cluster_count > fat_entries - 2) cluster_count = fat_entries - 2;
+    if (cluster_count > (size - data_start) / data.cluster_size) cluster_count = (size - data_start) / data.cluster_size;
+    data.cluster_count = cluster_count > 0 ? cluster_count : 0;
+
+    if (data.fat_type == 32) {
+        // FAT32 stores the root directory as a regular cluster chain
+        data.root_cluster = get_bytes(file_system, 0x02C, 4);
+        if (!valid_cluster(data.root_cluster)) return 0;
+        data.root_directory_start = cluster_offset(data.root_cluster);
+        data.cluster_high_mask = 0xFFFF;
+    } else {
+        data.root_cluster = 0;
+        data.cluster_high_mask = 0;
+    }
+
+    // Allocated once per image, so searching the directory tree doesn't allocate
+    free(data.visited);
+    data.visited_size = ((size_t)data.cluster_count + 2 + 7) / 8;
+    data.visited = calloc(data.visited_size, 1);
+    if (data.visited == NULL) return 0;
+    return 1;
+}
+
+// Mark a directory's start cluster as searched, returning 0 if it is invalid or was already searched
+int mark_visited(unsigned int cluster) {
+    if (!valid_cluster(cluster) || (data.visited[cluster / 8] & (1 << (cluster % 8)))) return 0;
+    data.visited[cluster / 8] |= 1 << (cluster % 8);
+    return 1;
+}
+
+// Get the first cluster of an entry, including the FAT32 high word
+unsigned int entry_start_cluster(void *file_system, off_t entry) {
+    return ((get_bytes(file_system, entry + 0x14, 2) & data.cluster_high_mask) << 16) | get_bytes(file_system, entry + 0x1A, 2);
+}
+
+// Start reading a directory, where cluster 0 refers to the root directory
+void dir_open(struct dir_cursor *dir, unsigned int cluster) {
+    if (cluster == 0) cluster = data.root_cluster;
+    dir->cluster = cluster;
+    guard_start(&dir->guard, cluster);
+    if (cluster == 0) {
+        // FAT12/16 keep the root directory in a fixed region before the data area
+        dir->offset = data.root_directory_start;
+        dir->end = data.root_directory_start + (data.max_entries * 32);
+    } else if (valid_cluster(cluster)) {
+        dir->offset = cluster_offset(cluster);
+        dir->end = dir->offset + data.cluster_size;
+    } else {
+        // Treat directories with a corrupt start cluster as empty
+        dir->offset = 0;
+        dir->end = 0;
+    }
+}
+
+// Move to the next entry, leaving offset == end once the directory is exhausted
+void dir_next(void *file_system, struct dir_cursor *dir) {
+    dir->offset += 32;
+    // Only the step to the next cluster depends on the FAT width
+    if (dir->offset == dir->end && dir->cluster != 0) {
+        data.ops->next_dir_cluster(file_system, dir);
+    }
+}
+
+// An LFN sequence has at most 20 entries of 13 UTF-16 units, each taking at most 3 bytes of UTF-8
+#define LFN_MAX_PARTS 20
+#define LFN_MAX_UNITS (LFN_MAX_PARTS * 13)
+#define NAME_SIZE (LFN_MAX_UNITS * 3 + 1)
+#define PATH_SIZE 4096
+// Bounds the recursion of search_fs() on images with absurdly deep directory trees
+#define MAX_DIR_LEVELS 128
+
+// Scratch space for assembling the long filename (VFAT LFN) of the next short entry
+struct lfn_state {
+    int checksum, next_seq, length;
+    // Where each entry of the sequence is, so units are only read when a name is needed
+    off_t parts[LFN_MAX_PARTS];
+    unsigned short units[LFN_MAX_UNITS];
+    char name[NAME_SIZE];
+};
+
+void lfn_reset(struct lfn_state *lfn) {
+    lfn->checksum = -1;
+    lfn->next_seq = 0;
+}
+
+// Checksum of the 8.3 name that every LFN entry of a sequence must carry
+int short_name_checksum(void *file_system, off_t entry) {
+    unsigned char sum = 0;
+    for (int i = 0; i < 11; i++) {
+        sum = ((sum & 1) << 7) + (sum >> 1) + get_bytes(file_system, entry + i, 1);
+    }
+    return sum;
+}
+
+// Add an LFN entry (attribute 0x0F) to the sequence being assembled
+void lfn_add(void *file_system, struct lfn_state *lfn, off_t entry) {
+    int ord = get_bytes(file_system, entry, 1);
+    int seq = ord & 0x1F;
+    int checksum = get_bytes(file_system, entry + 0x0D, 1);
+
+    // LFN entries are stored last part first, with 0x40 marking the start of a sequence
+    if (ord & 0x40) {
+        lfn->checksum = checksum;
+        lfn->next_seq = seq;
+        // Names that fill their last entry have no terminator, so remember the sequence length
+        lfn->length = seq * 13;
+    }
+    // Erased, out of order or mismatched parts invalidate the whole sequence
+    if (ord == 0xE5 || seq == 0 || seq * 13 > LFN_MAX_UNITS || seq != lfn->next_seq || checksum != lfn->checksum) {
+        lfn_reset(lfn);
+        return;
+    }
+
+    lfn->parts[seq - 1] = entry;
+    lfn->next_seq--;
+}
+
+// Get unit i of the name, where each entry holds 13 UTF-16 units split over three fields
+unsigned int lfn_unit(void *file_system, struct lfn_state *lfn, int i) {
+    int field = i % 13;
+    int offset = field < 5 ? 0x01 + field * 2 : field < 11 ? 0x0E + (field - 5) * 2 : 0x1C + (field - 11) * 2;
+    return get_bytes(file_system, lfn->parts[i / 13] + offset, 2);
+}
+
+// Check whether the long name belonging to a short entry is the given name of length units,
+// encoded as little-endian UTF-16 like the LFN entries themselves
+int lfn_matches(void *file_system, struct lfn_state *lfn, off_t entry, unsigned char *name, int length) {
+    int complete = lfn->checksum >= 0 && lfn->next_seq == 0;
+    int checksum = lfn->checksum;
+    lfn_reset(lfn);
+    if (!complete || length < 0 || length > lfn->length) return 0;
+
+    // Names of another length don't end here, unless this one fills the whole sequence
+    if (length < lfn->length) {
+        unsigned int end = lfn_unit(file_system, lfn, length);
+        if (end != 0x0000 && end != 0xFFFF) return 0;
+    }
+
+    // Compare the entries in place, last part first since that is where similar names usually differ
+    for (int part = (length - 1) / 13; part >= 0; part--) {
+        unsigned char *units = (unsigned char *)file_system + lfn->parts[part];
+        unsigned char *expected = name + part * 26;
+        int count = length - part * 13 < 13 ? length - part * 13 : 13;
+        // The 13 units are split over fields of 5, 6 and 2 units
+        if (memcmp(units + 0x01, expected, 2 * (count < 5 ? count : 5)) != 0) return 0;
+        if (count > 5 && memcmp(units + 0x0E, expected + 10, 2 * (count < 11 ? count - 5 : 6)) != 0) return 0;
+        if (count > 11 && memcmp(units + 0x1C, expected + 22, 2 * (count - 11)) != 0) return 0;
+    }
+
+    // The sequence must belong to this short entry
+    return checksum == short_name_checksum(file_system, entry);
+}
+
+// Get the UTF-8 long name belonging to a short entry, or NULL if it has none
+char *lfn_name(void *file_system, struct lfn_state *lfn, off_t entry) {
+    // The sequence must be complete and belong to this short entry
+    if (lfn->checksum < 0 || lfn->next_seq != 0 || lfn->checksum != short_name_checksum(file_system, entry)) {
+        lfn_reset(lfn);
+        return NULL;
+    }
+    lfn_reset(lfn);
+
+    // Read units up to the terminator, or to the end of the sequence
+    int length = 0;
+    while (length < lfn->length && (lfn->units[length] = lfn_unit(file_system, lfn, length)) != 0x0000 && lfn->units[length] != 0xFFFF) length++;
+
+    char *out = lfn->name;
+    for (int i = 0; i < length; i++) {
+        unsigned int c = lfn->units[i];
+        // Combine surrogate pairs into a single code point
+        if (c >= 0xD800 && c < 0xDC00 && i + 1 < length && lfn->units[i + 1] >= 0xDC00 && lfn->units[i + 1] < 0xE000) {
+            c = 0x10000 + ((c - 0xD800) << 10) + (lfn->units[++i] - 0xDC00);
+        }
+        if (c < 0x80) {
+            *out++ = c;
+        } else if (c < 0x800) {
+            *out++ = 0xC0 | (c >> 6);
+            *out++ = 0x80 | (c & 0x3F);
+        } else if (c < 0x10000) {
+            *out++ = 0xE0 | (c >> 12);
+            *out++ = 0x80 | ((c >> 6) & 0x3F);
+            *out++ = 0x80 | (c & 0x3F);
+        } else {
+            *out++ = 0xF0 | (c >> 18);
+            *out++ = 0x80 | ((c >> 12) & 0x3F);
+            *out++ = 0x80 | ((c >> 6) & 0x3F);
+            *out++ = 0x80 | (c & 0x3F);
+        }
+    }
+    *out = '\0';
+    return lfn->name;
+}
+
+// Convert a UTF-8 path component once to the little-endian UTF-16 of LFN entries, so lookups
+// compare long names without converting them. Returns the number of units, or -1 if it can't be a long name.
+int utf8_to_utf16(const char *name, unsigned char units[LFN_MAX_UNITS * 2]) {
+    const unsigned char *in = (const unsigned char *)name;
+    int length = 0;
+    while (*in != '\0') {
+        unsigned int c;
+        int extra;
+        if (*in < 0x80) {
+            c = *in;
+            extra = 0;
+        } else if (*in >= 0xC2 && *in < 0xE0) {
+            c = *in & 0x1F;
+            extra = 1;
+        } else if (*in >= 0xE0 && *in < 0xF0) {
+            c = *in & 0x0F;
+            extra = 2;
+        } else if (*in >= 0xF0 && *in < 0xF5) {
+            c = *in & 0x07;
+            extra = 3;
+        } else {
+            return -1;
+        }
+        in++;
+        for (int i = 0; i < extra; i++, in++) {
+            if ((*in & 0xC0) != 0x80) return -1;
+            c = (c << 6) | (*in & 0x3F);
+        }
+        // Overlong encodings and code points past U+10FFFF never come out of a long name
+        if ((extra == 2 && c < 0x800) || (extra == 3 && (c < 0x10000 || c > 0x10FFFF))) return -1;
+
+        // 0xFFFF pads the last LFN entry, so it ends a long name
+        if (c == 0xFFFF) return -1;
+        // Code points outside the BMP take a surrogate pair
+        if (length + (c >= 0x10000 ? 2 : 1) > LFN_MAX_UNITS) return -1;
+        if (c >= 0x10000) {
+            c -= 0x10000;
+            unsigned int high = 0xD800 + (c >> 10);
+            units[length * 2] = high & 0xFF;
+            units[length * 2 + 1] = high >> 8;
+            length++;
+            c = 0xDC00 + (c & 0x3FF);
+        }
+        units[length * 2] = c & 0xFF;
+        units[length * 2 + 1] = c >> 8;
+        length++;
+    }
+    return length;
+}
+
+// Build the trimmed 8.3 name of an entry, such as "README.TXT"
+void short_name(void *file_system, off_t entry, char *name) {
+    int len = 8;
+    while (len > 1 && get_bytes(file_system, entry + len - 1, 1) == ' ') len--;
+    memcpy(name, file_system + entry, len);
+
+    int ext_len = 3;
+    while (ext_len > 0 && get_bytes(file_system, entry + 0x08 + ext_len - 1, 1) == ' ') ext_len--;
+    // Don't concatenate a '.' if there is no extension
+    if (ext_len > 0) {
+        name[len++] = '.';
+        memcpy(name + len, file_system + entry + 0x08, ext_len);
+        len += ext_len;
+    }
+    name[len] = '\0';
 }
 
 // Add entry data to structure
-void build_entry_data(void *file_system, int offset, int root_directory_entry_offset) {
+void build_entry_data(void *file_system, off_t offset, int root_directory_entry_offset) {
     // Get date created information of entry
     entry_data.create_date = get_bytes(file_system, offset + root_directory_entry_offset + 0x10, 2);
     entry_data.day = entry_data.create_date & 0b11111;
@@ -106,6 +539,9 @@ void test_mmap(void *file_system) {
     int address;
     // Read type and location from stdin
     while (scanf("%c %d\n", &type, &address) > 0) {
+        // Skip reads that would fall outside the image
+        int width = (type == 'c' || type == 'b') ? 1 : (type == 's' || type == 'w') ? 2 : 4;
+        if (address < 0 || address > data.image_size - width) continue;
         switch (type) {
             case 'c':
                 printf("%c\n", (char)get_bytes(file_system, address, 1));
@@ -149,37 +585,42 @@ void test_boot_sector(void *file_system) {
 
 // Print out root directory entry information
 void test_directory_entry(void *file_system, int entry) {
-    // Get entry starting byte
-    int root_directory_entry_offset = entry * 32;
-
-    build_entry_data(file_system, data.root_directory_start, root_directory_entry_offset);
+    // Walk the root directory up to the requested entry
+    struct dir_cursor dir;
+    dir_open(&dir, 0);
+    for (int i = 0; i < entry && dir.offset < dir.end; i++) {
+        dir_next(file_system, &dir);
+    }
+    off_t offset = dir.offset;
 
     // Determine if the entry is empty
-    if (get_bytes(file_system, data.root_directory_start + root_directory_entry_offset, 8) == 0) {
+    if (dir.offset == dir.end || (get_bytes(file_system, offset, 4) | get_bytes(file_system, offset + 4, 4)) == 0) {
         printf("Empty entry\n");
     } else {
+        build_entry_data(file_system, offset, 0);
+
         // Determine if entry was previously erased
-        if (get_bytes(file_system, data.root_directory_start + root_directory_entry_offset + 0x00 + 0, 1) == 0xE5) {
+        if (get_bytes(file_system, offset + 0x00 + 0, 1) == 0xE5) {
             printf("Previously erased entry\n");
             printf("Name: ");
             printf("?");
         } else {
             printf("Name: ");
-            printf("%c", get_bytes(file_system, data.root_directory_start + root_directory_entry_offset + 0x00 + 0, 1));
+            printf("%c", get_bytes(file_system, offset + 0x00 + 0, 1));
         }
         // Get file name
         for (int i = 1; i < 8; i++) {
-            printf("%c", get_bytes(file_system, data.root_directory_start + root_directory_entry_offset + 0x00 + i, 1));
+            printf("%c", get_bytes(file_system, offset + 0x00 + i, 1));
         }
         printf(".");
         // Get file extension
         for (int i = 0; i < 3; i++) {
-            printf("%c", get_bytes(file_system, data.root_directory_start + root_directory_entry_offset + 0x08 + i, 1));
+            printf("%c", get_bytes(file_system, offset + 0x08 + i, 1));
         }
         printf("\n");
 
         // Determine file attributes
-        int tmp = get_bytes(file_system, data.root_directory_start + root_directory_entry_offset + 0x0B, 1);
+        int tmp = get_bytes(file_system, offset + 0x0B, 1);
         char *file_attributes;
         if (tmp == 0x20) {
             file_attributes = "archive ";
@@ -203,68 +644,50 @@ void test_directory_entry(void *file_system, int entry) {
         printf("File Attributes: %s\n", file_attributes);
         printf("Create time: %02d/%02d/%02d %02d:%02d:%02d.%03d\n", entry_data.year, entry_data.month, entry_data.day, entry_data.hours, entry_data.minutes, entry_data.seconds, entry_data.ms);
         printf("Access date: %02d/%02d/%02d\n", entry_data.access_year, entry_data.access_month, entry_data.access_day);
-        printf("Extended attributes: %d\n", get_bytes(file_system, data.root_directory_start + root_directory_entry_offset + 0x14, 2));
+        printf("Extended attributes: %d\n", get_bytes(file_system, offset + 0x14, 2));
         printf("Modify time: %02d/%02d/%02d %02d:%02d:%02d.%03d\n", entry_data.modify_year, entry_data.modify_month, entry_data.modify_day, entry_data.modify_hours, entry_data.modify_minutes, entry_data.modify_seconds, entry_data.modify_ms);
-        printf("Start cluster: %d\n", get_bytes(file_system, data.root_directory_start + root_directory_entry_offset + 0x1A, 2));
-        printf("Bytes: %d\n", get_bytes(file_system, data.root_directory_start + root_directory_entry_offset + 0x1C, 4));
+        printf("Start cluster: %u\n", entry_start_cluster(file_system, offset));
+        printf("Bytes: %d\n", get_bytes(file_system, offset + 0x1C, 4));
     }
 }
 
 // Print cluster linked list
-void test_file_clusters(void *file_system, int cluster) {
-    // Clusters 0 and 1 are reserved for the FAT id and EOF
-    if (cluster < 2) {
-        printf("EOF\n");
-        return;
-    }
-
-    // Start at given cluster
-    int tmp = cluster;
-    // Print linked list of clusters
-    while (tmp != 0xFFFF && tmp > 1) {
-        printf("%d", tmp);
-        printf(" -> ");
-        // Jump to the next node in linked list
-        tmp = get_bytes(file_system, data.fat_start + tmp * 2, 2);
-    }
-    printf("EOF\n");
+void test_file_clusters(void *file_system, unsigned int cluster) {
+    data.ops->print_chain(file_system, cluster);
 }
 
-
 // Finds file entries by file name and prints file information
 void test_file_name(void *file_system, char *filename) {
-    int offset = data.root_directory_start;
+    // Start in the root directory
+    unsigned int dir_cluster = 0;
 
     // Split filename by '/' to look in each directory
     char *token = strtok(filename, "/");
     while (token != NULL) {
-        for (int i = 0; i < data.max_entries * 32; i += 32) {
+        unsigned char token_units[LFN_MAX_UNITS * 2];
+        int token_length = utf8_to_utf16(token, token_units);
+        struct dir_cursor dir;
+        struct lfn_state lfn;
+        lfn_reset(&lfn);
+        for (dir_open(&dir, dir_cluster); dir.offset < dir.end; dir_next(file_system, &dir)) {
+            off_t entry = dir.offset;
             // Empty entry
-            if (get_bytes(file_system, offset + i + 0x00, 1) == 0) {
+            if (get_bytes(file_system, entry + 0x00, 1) == 0) {
                 break;
             }
-            char name[100] = "";
-            // Get file name
-            strncat(name, file_system + offset + i, 8);
-            // Trim trailing whitespace
-            int idx;
-            idx = strlen(name) - 1;
-            while (name[idx] == ' ' && idx > 0) idx--;
-            name[++idx] = '\0';
-            // Don't concatenate a '.' if there is no extension
-            if (get_bytes(file_system, offset + i + 0x08, 1) == ' ') {
-                ;
-            } else {
-                // Get file extension
-                strcat(name, ".");
-                strncat(name, file_system + offset + i + 0x08, 3);
+            // Collect long filename parts until the short entry they belong to
+            if (get_bytes(file_system, entry + 0x0B, 1) == 0x0F) {
+                lfn_add(file_system, &lfn, entry);
+                continue;
             }
+            // Either the long or the 8.3 name may be used to find an entry
+            char name[13];
+            short_name(file_system, entry, name);
+            int long_match = lfn_matches(file_system, &lfn, entry, token_units, token_length);
 
-            if (strcmp(token, name) == 0) {
-                int root_directory_entry_offset = i;
-
+            if (long_match || strcmp(token, name) == 0) {
                 // Determine file attributes
-                int tmp = get_bytes(file_system, offset + root_directory_entry_offset + 0x0B, 1);
+                int tmp = get_bytes(file_system, entry + 0x0B, 1);
                 char *file_attributes;
                 if (tmp == 32) {
                     file_attributes = "archive ";
@@ -276,39 +699,38 @@ void test_file_name(void *file_system, char *filename) {
 
                 // If the current entry is a directory, reset to the new cluster offset
                 if (strcmp(file_attributes, "subdir ") == 0) {
-                    int start_cluster = get_bytes(file_system, offset + root_directory_entry_offset + 0x1A, 2);
-                    offset = ((data.bytes_per_sector * data.sectors_per_cluster) * (start_cluster - 2)) + ((32 * data.max_entries) + data.root_directory_start);
+                    dir_cluster = entry_start_cluster(file_system, entry);
                     break;
                 }
 
-                build_entry_data(file_system, offset, root_directory_entry_offset);
+                build_entry_data(file_system, entry, 0);
 
                 // Empty entry
-                if (get_bytes(file_system, offset + root_directory_entry_offset, 8) == 0) {
+                if ((get_bytes(file_system, entry, 4) | get_bytes(file_system, entry + 4, 4)) == 0) {
                     printf("Empty entry\n");
                 } else {
                     // Determine if entry was previously erased
-                    if (get_bytes(file_system, offset + root_directory_entry_offset + 0x00 + 0, 1) == 0xE5) {
+                    if (get_bytes(file_system, entry + 0x00 + 0, 1) == 0xE5) {
                         printf("Previously erased entry\n");
                         printf("Name: ");
                         printf("?");
                     } else {
                         printf("Name: ");
-                        printf("%c", get_bytes(file_system, offset + root_directory_entry_offset + 0x00 + 0, 1));
+                        printf("%c", get_bytes(file_system, entry + 0x00 + 0, 1));
                     }
                     // Get file name
                     for (int i = 1; i < 8; i++) {
-                        printf("%c", get_bytes(file_system, offset + root_directory_entry_offset + 0x00 + i, 1));
+                        printf("%c", get_bytes(file_system, entry + 0x00 + i, 1));
                     }
                     printf(".");
                     // Get file extension
                     for (int i = 0; i < 3; i++) {
-                        printf("%c", get_bytes(file_system, offset + root_directory_entry_offset + 0x08 + i, 1));
+                        printf("%c", get_bytes(file_system, entry + 0x08 + i, 1));
                     }
                     printf("\n");
 
                     // Determine file attributes
-                    int tmp = get_bytes(file_system, offset + root_directory_entry_offset + 0x0B, 1);
+                    int tmp = get_bytes(file_system, entry + 0x0B, 1);
                     char *file_attributes;
                     if (tmp == 32) {
                         file_attributes = "archive ";
@@ -322,10 +744,10 @@ void test_file_name(void *file_system, char *filename) {
                     printf("File Attributes: %s\n", file_attributes);
                     printf("Create time: %02d/%02d/%02d %02d:%02d:%02d.%03d\n", entry_data.year, entry_data.month, entry_data.day, entry_data.hours, entry_data.minutes, entry_data.seconds, entry_data.ms);
                     printf("Access date: %02d/%02d/%02d\n", entry_data.access_year, entry_data.access_month, entry_data.access_day);
-                    printf("Extended attributes: %d\n", get_bytes(file_system, offset + root_directory_entry_offset + 0x14, 2));
+                    printf("Extended attributes: %d\n", get_bytes(file_system, entry + 0x14, 2));
                     printf("Modify time: %02d/%02d/%02d %02d:%02d:%02d.%03d\n", entry_data.modify_year, entry_data.modify_month, entry_data.modify_day, entry_data.modify_hours, entry_data.modify_minutes, entry_data.modify_seconds, entry_data.modify_ms);
-                    printf("Start cluster: %d\n", get_bytes(file_system, offset + root_directory_entry_offset + 0x1A, 2));
-                    printf("Bytes: %d\n", get_bytes(file_system, offset + root_directory_entry_offset + 0x1C, 4));
+                    printf("Start cluster: %u\n", entry_start_cluster(file_system, entry));
+                    printf("Bytes: %d\n", get_bytes(file_system, entry + 0x1C, 4));
                 }
             }
         }
@@ -336,37 +758,35 @@ void test_file_name(void *file_system, char *filename) {
 
 // Print out the contents of a given filename
 void test_file_contents(void *file_system, char *filename) {
-    int offset = data.root_directory_start;
+    // Start in the root directory
+    unsigned int dir_cluster = 0;
 
     // Split filename by '/' to look in each directory
     char *token = strtok(filename, "/");
     while (token != NULL) {
-        for (int i = 0; i < data.max_entries * 32; i += 32) {
+        unsigned char token_units[LFN_MAX_UNITS * 2];
+        int token_length = utf8_to_utf16(token, token_units);
+        struct dir_cursor dir;
+        struct lfn_state lfn;
+        lfn_reset(&lfn);
+        for (dir_open(&dir, dir_cluster); dir.offset < dir.end; dir_next(file_system, &dir)) {
+            off_t entry = dir.offset;
             // Empty entry
-            if (get_bytes(file_system, offset + i + 0x00, 1) == 0) {
+            if (get_bytes(file_system, entry + 0x00, 1) == 0) {
                 break;
             }
-            char name[100] = "";
-            // Get file name
-            strncat(name, file_system + offset + i, 8);
-            // Trim trailing whitespace
-            int idx;
-            idx = strlen(name) - 1;
-            while (name[idx] == ' ' && idx > 0) idx--;
-            name[++idx] = '\0';
-            // Don't concatenate a '.' if there is no extension
-            if (get_bytes(file_system, offset + i + 0x08, 1) == ' ') {
-                ;
-            } else {
-                // Get file extension
-                strcat(name, ".");
-                strncat(name, file_system + offset + i + 0x08, 3);
+            // Collect long filename parts until the short entry they belong to
+            if (get_bytes(file_system, entry + 0x0B, 1) == 0x0F) {
+                lfn_add(file_system, &lfn, entry);
+                continue;
             }
-            if (strcmp(token, name) == 0) {
-                int root_directory_entry_offset = i;
-
+            // Either the long or the 8.3 name may be used to find an entry
+            char name[13];
+            short_name(file_system, entry, name);
+            int long_match = lfn_matches(file_system, &lfn, entry, token_units, token_length);
+            if (long_match || strcmp(token, name) == 0) {
                 // Determine file attributes
-                int tmp = get_bytes(file_system, offset + root_directory_entry_offset + 0x0B, 1);
+                int tmp = get_bytes(file_system, entry + 0x0B, 1);
                 char *file_attributes;
                 if (tmp == 32) {
                     file_attributes = "archive ";
@@ -376,18 +796,14 @@ void test_file_contents(void *file_system, char *filename) {
                     file_attributes = "";
                 }
 
-                int start_cluster = get_bytes(file_system, offset + root_directory_entry_offset + 0x1A, 2);
+                unsigned int start_cluster = entry_start_cluster(file_system, entry);
                 // If the current entry is a directory, reset to the new cluster offset
                 if (strcmp(file_attributes, "subdir ") == 0) {
-                    offset = ((data.bytes_per_sector * data.sectors_per_cluster) * (start_cluster - 2)) + ((32 * data.max_entries) + data.root_directory_start);
+                    dir_cluster = start_cluster;
                     break;
                 } else {
-                    // Print out file contents
-                    int filesize = get_bytes(file_system, offset + root_directory_entry_offset + 0x1C, 4);
-                    int file_start_offset = ((data.bytes_per_sector * data.sectors_per_cluster) * (start_cluster - 2)) + ((32 * data.max_entries) + data.root_directory_start);
-                    for (int i = 0; i < filesize; i++) {
-                        printf("%c", get_bytes(file_system, file_start_offset + i, 1));
-                    }
+                    // Print out file contents one cluster at a time, following the FAT chain
+                    data.ops->print_file(file_system, start_cluster, get_bytes(file_system, entry + 0x1C, 4));
                 }
             }
         }
@@ -397,60 +813,58 @@ void test_file_contents(void *file_system, char *filename) {
 }
 
 // Search file system for all possible attributes/statistics
-void search_fs(void *file_system, int offset, int *num_root_dir_files, int *num_files, int *num_dirs, char curr_name[100], char file_name[100], int *max_file_size, int *size_of_files, int *curr_level, int *max_level) {
+void search_fs(void *file_system, unsigned int dir_cluster, int *num_root_dir_files, int *num_files, int *num_dirs, char curr_name[PATH_SIZE], char file_name[PATH_SIZE], int *max_file_size, long long *size_of_files, int *curr_level, int *max_level) {
     // Increase directory level since we recursed into a directory
     (*curr_level)++;
+    // Directories linked from more than one entry, or back to the root with cluster 0, are only searched once
+    if (*curr_level > MAX_DIR_LEVELS || !mark_visited(dir_cluster)) return;
     if (*curr_level > *max_level) {
         *max_level = *curr_level;
     }
 
     // Loop through current directory
-    for (int i = 0; i < data.max_entries * 32; i += 32) {
+    struct dir_cursor dir;
+    struct lfn_state lfn;
+    lfn_reset(&lfn);
+    for (dir_open(&dir, dir_cluster); dir.offset < dir.end; dir_next(file_system, &dir)) {
+        off_t entry = dir.offset;
         // Empty entry, doesn't count for total numbers
-        if (get_bytes(file_system, offset + i + 0x00, 1) == 0 || get_bytes(file_system, offset + i + 0x00 + 0, 1) == 0x2E || get_bytes(file_system, offset + i + 0x00 + 0, 1) == 0xE5) {
+        if (get_bytes(file_system, entry + 0x00, 1) == 0 || get_bytes(file_system, entry + 0x00 + 0, 1) == 0x2E || get_bytes(file_system, entry + 0x00 + 0, 1) == 0xE5) {
             break;
         }
 
-        int root_directory_entry_offset = i;
-
-        // Get file name
-        strcat(curr_name, "/");
-        strncat(curr_name, file_system + offset + i, 8);
-
-        // Trim trailing whitespace
-        int idx;
-        idx = strlen(curr_name) - 1;
-        while ((curr_name)[idx] == ' ' && idx > 0) idx--;
-        (curr_name)[++idx] = '\0';
-
-        // Don't concatenate a '.' if there is no extension
-        if (get_bytes(file_system, offset + i + 0x08, 1) == ' ') {
-            ;
-        } else {
-            // Get file extension
-            strcat(curr_name, ".");
-            strncat(curr_name, file_system + offset + i + 0x08, 3);
+        // Collect long filename parts until the short entry they belong to
+        if (get_bytes(file_system, entry + 0x0B, 1) == 0x0F) {
+            lfn_add(file_system, &lfn, entry);
+            continue;
         }
 
+        // Append the entry name to the path, preferring the long name
+        char name[13];
+        short_name(file_system, entry, name);
+        char *long_name = lfn_name(file_system, &lfn, entry);
+        int path_len = strlen(curr_name);
+        snprintf(curr_name + path_len, PATH_SIZE - path_len, "/%s", long_name != NULL ? long_name : name);
+
         // Determine file attributes
-        int tmp = get_bytes(file_system, offset + root_directory_entry_offset + 0x0B, 1);
-        if (tmp == 0x20 && !(get_bytes(file_system, offset + root_directory_entry_offset + 0x00 + 0, 1) == 0xE5)) {
+        int tmp = get_bytes(file_system, entry + 0x0B, 1);
+        if (tmp == 0x20 && !(get_bytes(file_system, entry + 0x00 + 0, 1) == 0xE5)) {
             (*num_files)++;
-            int curr_file_size = get_bytes(file_system, offset + root_directory_entry_offset + 0x1C, 4);
+            int curr_file_size = get_bytes(file_system, entry + 0x1C, 4);
             if (curr_file_size > *max_file_size) {
                 *max_file_size = curr_file_size;
                 strcpy(file_name, curr_name);
             }
-            *size_of_files += get_bytes(file_system, offset + root_directory_entry_offset + 0x1C, 4);
-        } else if (tmp == 0x10 && !(get_bytes(file_system, offset + i + 0x00, 1) == 0x2E) && !(get_bytes(file_system, offset + root_directory_entry_offset + 0x00 + 0, 1) == 0xE5)) {
+            *size_of_files += get_bytes(file_system, entry + 0x1C, 4);
+        } else if (tmp == 0x10 && !(get_bytes(file_system, entry + 0x00, 1) == 0x2E) && !(get_bytes(file_system, entry + 0x00 + 0, 1) == 0xE5)) {
             (*num_dirs)++;
-            // Calculate the starting offset for next directory
-            int start_cluster = get_bytes(file_system, offset + root_directory_entry_offset + 0x1A, 2);
-            int jump = ((data.bytes_per_sector * data.sectors_per_cluster) * (start_cluster - 2)) + ((32 * data.max_entries) + data.root_directory_start);
+            // Recurse into the directory starting at its first cluster
+            unsigned int jump = entry_start_cluster(file_system, entry);
             search_fs(file_system, jump, num_root_dir_files, num_files, num_dirs, curr_name, file_name, max_file_size, size_of_files, curr_level, max_level);
             // After recursing through a directory, travel back up
             (*curr_level)--;
         }
+        curr_name[path_len] = '\0';
     }
 }
 
@@ -462,14 +876,15 @@ void get_stats(void *file_system, char mode) {
 
     int curr_file_size = 0;
     int max_file_size = 0;
-    char file_name[100] = "";
+    char file_name[PATH_SIZE] = "";
 
-    int capacity = 0;
+    long long capacity = 0;
     int active_entry_count = 0;
-    int all_space = 0;
-    int size_of_files = 0;
-    int unused_all_space = 0;
-    int unall_space = 0;
+    // File sizes and capacities can exceed the range of an int on large images
+    long long all_space = 0;
+    long long size_of_files = 0;
+    long long unused_all_space = 0;
+    long long unall_space = 0;
 
     // Root level is the first level
     int curr_level = 1;
@@ -480,54 +895,52 @@ void get_stats(void *file_system, char mode) {
 
     char *oldest_file_name = "";
 
-    int offset = data.root_directory_start;
+    // No directory has been searched yet, apart from a FAT32 root directory which is searched here
+    memset(data.visited, 0, data.visited_size);
+    if (data.root_cluster != 0) mark_visited(data.root_cluster);
 
     // Loop through the root directory
-    for (int i = 0; i < data.max_entries * 32; i += 32) {
+    struct dir_cursor dir;
+    struct lfn_state lfn;
+    lfn_reset(&lfn);
+    for (dir_open(&dir, 0); dir.offset < dir.end; dir_next(file_system, &dir)) {
+        off_t entry = dir.offset;
         // Empty entry, doesn't count for total numbers
-        if (get_bytes(file_system, offset + i + 0x00, 1) == 0) {
+        if (get_bytes(file_system, entry + 0x00, 1) == 0) {
             break;
         }
 
-        int root_directory_entry_offset = i;
-
-        // Get file name
-        char curr_name[100] = "";
-        strcat(curr_name, "/");
-        strncat(curr_name, file_system + offset + i, 8);
-
-        // Trim trailing whitespace
-        int idx;
-        idx = strlen(curr_name) - 1;
-        while (curr_name[idx] == ' ' && idx > 0) idx--;
-        curr_name[++idx] = '\0';
-
-        // Don't concatenate a '.' if there is no extension
-        if (get_bytes(file_system, offset + i + 0x08, 1) == ' ') {
-            ;
-        } else {
-            // Get file extension
-            strcat(curr_name, ".");
-            strncat(curr_name, file_system + offset + i + 0x08, 3);
+        // Collect long filename parts until the short entry they belong to
+        if (get_bytes(file_system, entry + 0x0B, 1) == 0x0F) {
+            lfn_add(file_system, &lfn, entry);
+            continue;
         }
 
+        // Get file name, preferring the long name
+        char name[13];
+        short_name(file_system, entry, name);
+        char *long_name = lfn_name(file_system, &lfn, entry);
+        char curr_name[PATH_SIZE];
+        snprintf(curr_name, PATH_SIZE, "/%s", long_name != NULL ? long_name : name);
+
         // Determine file attributes
-        int tmp = get_bytes(file_system, offset + root_directory_entry_offset + 0x0B, 1);
-        if (tmp == 0x20 && !(get_bytes(file_system, offset + root_directory_entry_offset + 0x00 + 0, 1) == 0xE5)) {
+        int tmp = get_bytes(file_system, entry + 0x0B, 1);
+        if (tmp == 0x20 && !(get_bytes(file_system, entry + 0x00 + 0, 1) == 0xE5)) {
             num_root_dir_files++;
             num_files++;
-            size_of_files += get_bytes(file_system, offset + root_directory_entry_offset + 0x1C, 4);
-            curr_file_size = get_bytes(file_system, offset + root_directory_entry_offset + 0x1C, 4);
+            size_of_files += get_bytes(file_system, entry + 0x1C, 4);
+            curr_file_size = get_bytes(file_system, entry + 0x1C, 4);
             if (curr_file_size > max_file_size) {
                 max_file_size = curr_file_size;
                 strcpy(file_name, curr_name);
             }
-        } else if (tmp == 0x10 && !(get_bytes(file_system, offset + root_directory_entry_offset + 0x00 + 0, 1) == 0xE5)) {
+        } else if (tmp == 0x10 && !(get_bytes(file_system, entry + 0x00 + 0, 1) == 0xE5)) {
             num_dirs++;
-            // Calculate the starting offset for next directory
-            int start_cluster = get_bytes(file_system, offset + root_directory_entry_offset + 0x1A, 2);
-            int jump = ((data.bytes_per_sector * data.sectors_per_cluster) * (start_cluster - 2)) + ((32 * data.max_entries) + data.root_directory_start);
+            // Recurse into the directory starting at its first cluster
+            unsigned int jump = entry_start_cluster(file_system, entry);
             search_fs(file_system, jump, &num_root_dir_files, &num_files, &num_dirs, curr_name, file_name, &max_file_size, &size_of_files, &curr_level, &max_level);
+            // After recursing through a directory, travel back up
+            curr_level--;
         }
     }
 
@@ -536,25 +949,19 @@ void get_stats(void *file_system, char mode) {
         printf("Number of files in the file system: %d\n", num_files);
         printf("Number of directories in the file system: %d\n", num_dirs);
     } else if (mode == 's') {
-        // Calculate FAT table start and size to get active entries
-        for (int i = data.fat_start + 4; i < data.fat_size; i += 2) {
-            if (!(get_bytes(file_system, i, 2) == 0)) active_entry_count++;
-        }
-
-        // Get number of logical sectors
-        int tmp = data.num_logical_sectors;
-        if (tmp == 0) tmp = get_bytes(file_system, 0x020, 4);
+        // Count the FAT entries in use to get the allocated space
+        active_entry_count = data.ops->count_allocated(file_system);
 
-        capacity = data.bytes_per_sector * tmp;
-        all_space = active_entry_count * (data.bytes_per_sector * data.sectors_per_cluster);
+        capacity = (long long)data.bytes_per_sector * data.total_sectors;
+        all_space = (long long)active_entry_count * data.cluster_size;
         unused_all_space = all_space - size_of_files;
         unall_space = capacity - all_space;
 
-        printf("Total capacity of the file system: %d\n", capacity);
-        printf("Total allocated space: %d\n", all_space);
-        printf("Total size of files: %d\n", size_of_files);
-        printf("Unused, but allocated, space (for files): %d\n", unused_all_space);
-        printf("Unallocated space: %d\n", unall_space);
+        printf("Total capacity of the file system: %lld\n", capacity);
+        printf("Total allocated space: %lld\n", all_space);
+        printf("Total size of files: %lld\n", size_of_files);
+        printf("Unused, but allocated, space (for files): %lld\n", unused_all_space);
+        printf("Unallocated space: %lld\n", unall_space);
     } else if (mode == 'l') {
         printf("Largest file (%d bytes): %s\n", max_file_size, file_name);
     } else if (mode == 'k') {
@@ -606,9 +1013,9 @@ int main(int argc, char **argv) {
 
     // Read given arguments into variables
     int option_index = 0;
-    char *image;
+    char *image = NULL;
     int entry;
-    int cluster;
+    unsigned int cluster;
     int c;
     char mode;
     char *filename;
@@ -626,6 +1033,7 @@ int main(int argc, char **argv) {
                 mode = c;
                 break;
             case 'v':
+                // Dumping bytes and the boot sector already works on invalid images
                 break;
             case 'b':
             case 'm':
@@ -653,12 +1061,25 @@ int main(int argc, char **argv) {
     // mmap() the given image to memory
     int fd = open(image, O_RDONLY, 0);
     struct stat st;
-    stat(image, &st);
-    int size = st.st_size;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        printf("Unable to open image\n");
+        return 1;
+    }
+    off_t size = st.st_size;
     void *file_system = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
     close(fd);
+    if (file_system == MAP_FAILED) {
+        printf("Unable to map file to virtual address\n");
+        return 1;
+    }
 
-    build_fs_data(file_system);
+    // Validate the image layout once so the tests that walk the FAT or directories only need to
+    // check values read from it. The other tests just need the boot sector to be there.
+    int valid = build_fs_data(file_system, size);
+    if (size < 512 || (!valid && mode != 'm' && mode != 'b')) {
+        printf("Invalid image\n");
+        return 1;
+    }
 
     // Test filesystem
     switch (mode) {
@@ -0,0 +1,71 @@
+// Fuzz harness for the image parser in fs.c.
+//
+// libFuzzer:  make fuzz && ./fs-fuzz
+// AFL:        afl-gcc -DFUZZ_STANDALONE -o fs-fuzz fuzz/fuzz-fs.c && afl-fuzz -i seeds -o findings ./fs-fuzz @@
+#include <stdint.h>
+
+// Pull in the parser without its command line entry point
+#define main fs_main
+#include "../fs.c"
+#undef main
+
+int LLVMFuzzerInitialize(int *argc, char ***argv) {
+    // The tests print everything they find, which only slows fuzzing down
+    freopen("/dev/null", "w", stdout);
+    return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *buf, size_t len) {
+    // Parse a private copy, like the MAP_PRIVATE mapping in main(), so sanitizers see its exact size
+    void *file_system = malloc(len > 0 ? len : 1);
+    memcpy(file_system, buf, len);
+
+    // Like main(), the boot sector is printed even when the rest of the layout is invalid
+    int valid = build_fs_data(file_system, len);
+    if (len >= 512) {
+        test_boot_sector(file_system);
+    }
+    if (valid) {
+        for (int i = 0; i < 32; i++) {
+            test_directory_entry(file_system, i);
+        }
+        for (unsigned int cluster = 0; cluster < 32; cluster++) {
+            test_file_clusters(file_system, cluster);
+        }
+
+        // Path lookups split their argument in place
+        char path[PATH_SIZE];
+        strcpy(path, "DOCS/SUB/README.TXT");
+        test_file_name(file_system, path);
+        strcpy(path, "DOCS/SUB/README.TXT");
+        test_file_contents(file_system, path);
+        // A long name with a surrogate pair, to reach the UTF-16 comparison
+        strcpy(path, "Documents and Settings/Read me first \xF0\x9F\x98\x80.txt");
+        test_file_name(file_system, path);
+
+        output_fs_data(file_system);
+    }
+
+    free(file_system);
+    return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+// Run each file given on the command line once, for AFL or for reproducing a crash
+int main(int argc, char **argv) {
+    LLVMFuzzerInitialize(&argc, &argv);
+    for (int i = 1; i < argc; i++) {
+        FILE *input = fopen(argv[i], "rb");
+        if (input == NULL) continue;
+        fseek(input, 0, SEEK_END);
+        long len = ftell(input);
+        fseek(input, 0, SEEK_SET);
+        uint8_t *buf = malloc(len > 0 ? len : 1);
+        len = fread(buf, 1, len, input);
+        fclose(input);
+        LLVMFuzzerTestOneInput(buf, len);
+        free(buf);
+    }
+    return 0;
+}
+#endif